@@ -8,7 +8,10 @@ module;
 #include <cstdlib>
 export module STMXX;
 import Util;
+export import :Profiler;
+export import :RedoLog;
 export import :Transaction;
+export import :TransactionNOrec;
 export import :TransactionVal;
 
 
@@ -0,0 +1,215 @@
+module;
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+export module STMXX:Profiler;
+
+export enum class abort_site : std::uint8_t { read, commit_lock, commit_validate };
+
+constexpr std::string_view site_name(abort_site site) {
+  switch (site) {
+    case abort_site::read:
+      return "read";
+    case abort_site::commit_lock:
+      return "commit_lock";
+    case abort_site::commit_validate:
+      return "commit_validate";
+  }
+  return "unknown";
+}
+
+// first conflict of a transaction attempt. tval is the address of the transaction_t.
+struct conflict_info {
+  const void *tval = nullptr;
+  abort_site site = abort_site::read;
+};
+
+export struct hotspot {
+  const void *tval = nullptr;
+  std::string name;
+  std::size_t aborts = 0;
+  std::array<std::size_t, 3> aborts_by_site = {};
+  std::chrono::nanoseconds wasted = {};
+};
+
+// opt-in conflict profiler shared by all transaction types.
+// records every transaction attempt while enabled, aborts are attributed to the first tval
+// that conflicted.
+export class profiler final {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  static void enable() {
+    std::lock_guard guard(mutex);
+    if (events.empty()) {
+      epoch = clock::now();
+    }
+    enabled.store(true, std::memory_order_release);
+  }
+  static void disable() { enabled.store(false, std::memory_order_release); }
+  static bool is_enabled() { return enabled.load(std::memory_order_relaxed); }
+  static void reset() {
+    std::lock_guard guard(mutex);
+    events.clear();
+    epoch = clock::now();
+  }
+
+  // user assigned name of a tval, used in reports and traces.
+  static void name(const void *tval, std::string name) {
+    std::lock_guard guard(mutex);
+    names.insert_or_assign(tval, std::move(name));
+  }
+
+  // tvals sorted by the time their conflicts wasted in aborted attempts.
+  static std::vector<hotspot> hotspots(std::size_t n) {
+    std::lock_guard guard(mutex);
+    std::unordered_map<const void *, hotspot> by_tval;
+    for (auto &event : events) {
+      if (event.committed || !event.conflict.tval) {
+        continue;
+      }
+      auto &spot = by_tval.try_emplace(event.conflict.tval).first->second;
+      spot.tval = event.conflict.tval;
+      ++spot.aborts;
+      ++spot.aborts_by_site[static_cast<std::size_t>(event.conflict.site)];
+      spot.wasted += event.end - event.start;
+    }
+    std::vector<hotspot> result;
+    for (auto &spot : by_tval | std::views::values) {
+      auto found = names.find(spot.tval);
+      spot.name = found != names.end() ? found->second : std::string();
+      result.push_back(std::move(spot));
+    }
+    std::ranges::sort(result, [](auto &a, auto &b) {
+      return a.wasted != b.wasted ? a.wasted > b.wasted : a.aborts > b.aborts;
+    });
+    if (result.size() > n) {
+      result.resize(n);
+    }
+    return result;
+  }
+
+  static void report(std::ostream &out, std::size_t n = 10) {
+    auto spots = hotspots(n);
+    out << "tval aborts wasted_us read commit_lock commit_validate\n";
+    for (auto &spot : spots) {
+      if (spot.name.empty()) {
+        out << spot.tval;
+      } else {
+        out << spot.name;
+      }
+      out << ' ' << spot.aborts << ' '
+          << std::chrono::duration_cast<std::chrono::microseconds>(spot.wasted).count();
+      for (auto count : spot.aborts_by_site) {
+        out << ' ' << count;
+      }
+      out << '\n';
+    }
+  }
+
+  // timeline of all recorded attempts in chrome trace event format (chrome://tracing, perfetto).
+  static void export_chrome_trace(std::ostream &out) {
+    std::lock_guard guard(mutex);
+    auto micros = [](auto duration) {
+      return std::chrono::duration<double, std::micro>(duration).count();
+    };
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    for (auto &event : events) {
+      out << (first ? "" : ",") << "{\"name\":\"" << (event.committed ? "commit" : "abort")
+          << "\",\"cat\":\"stm\",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.thread
+          << ",\"ts\":" << micros(event.start - epoch)
+          << ",\"dur\":" << micros(event.end - event.start);
+      // aborts without a conflicting tval, e.g. by an exception, carry no attribution.
+      if (!event.committed && event.conflict.tval) {
+        out << ",\"args\":{\"site\":\"" << site_name(event.conflict.site) << "\",\"tval\":\"";
+        auto found = names.find(event.conflict.tval);
+        if (found != names.end()) {
+          _escape(out, found->second);
+        } else {
+          out << event.conflict.tval;
+        }
+        out << "\"}";
+      }
+      out << '}';
+      first = false;
+    }
+    out << "]}\n";
+  }
+
+ private:
+  friend class profiled_attempt;
+  struct event {
+    std::uint64_t thread;
+    clock::time_point start;
+    clock::time_point end;
+    bool committed;
+    conflict_info conflict;
+  };
+
+  static void _record(event &&event) {
+    std::lock_guard guard(mutex);
+    events.push_back(std::move(event));
+  }
+
+  static std::uint64_t _thread_id() {
+    static std::atomic<std::uint64_t> next_id = 0;
+    thread_local std::uint64_t id = next_id.fetch_add(1, std::memory_order_relaxed);
+    return id;
+  }
+
+  static void _escape(std::ostream &out, std::string_view str) {
+    for (char c : str) {
+      if (c == '"' || c == '\\') {
+        out << '\\' << c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        out << ' ';
+      } else {
+        out << c;
+      }
+    }
+  }
+
+  inline static std::atomic<bool> enabled = false;
+  inline static std::mutex mutex;
+  inline static clock::time_point epoch = clock::now();
+  inline static std::vector<event> events;
+  inline static std::unordered_map<const void *, std::string> names;
+};
+
+// one transaction attempt, recorded when it goes out of scope.
+class profiled_attempt final {
+ public:
+  explicit profiled_attempt(const conflict_info &conflict)
+      : conflict(conflict), enabled(profiler::is_enabled()) {
+    if (enabled) {
+      start = profiler::clock::now();
+    }
+  }
+  profiled_attempt(profiled_attempt &other) = delete;
+  ~profiled_attempt() {
+    if (enabled) {
+      profiler::_record({.thread = profiler::_thread_id(),
+                         .start = start,
+                         .end = profiler::clock::now(),
+                         .committed = is_committed,
+                         .conflict = conflict});
+    }
+  }
+  void committed() { is_committed = true; }
+
+ private:
+  const conflict_info &conflict;
+  bool enabled;
+  bool is_committed = false;
+  profiler::clock::time_point start;
+};
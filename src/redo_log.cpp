@@ -0,0 +1,256 @@
+module;
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+export module STMXX:RedoLog;
+import Util;
+
+// a single tval write of a committed transaction.
+struct log_entry {
+  std::uint64_t key;
+  std::span<const std::byte> bytes;
+};
+
+constexpr std::array<std::uint32_t, 256> crc_table = [] {
+  std::array<std::uint32_t, 256> table;
+  for (std::uint32_t i = 0; i < 256; ++i) {
+    std::uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+    }
+    table[i] = crc;
+  }
+  return table;
+}();
+
+std::uint32_t crc32(std::span<const std::byte> bytes, std::uint32_t crc = 0) {
+  crc = ~crc;
+  for (auto byte : bytes) {
+    crc = crc_table[(crc ^ static_cast<std::uint8_t>(byte)) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+// append-only redo log in a memory mapped file.
+// layout: file magic, then records of [record_header][key, size, bytes]...
+// records are appended in write version order, recovery stops at the first torn record.
+class redo_log final {
+ public:
+  redo_log() {}
+  redo_log(redo_log &other) = delete;
+  ~redo_log() { close(); }
+
+  // maps the log and replays it. returns the last logged write version. refused while a log is
+  // open, and for existing files that are not a redo log.
+  std::optional<version_t> open(const std::filesystem::path &path) {
+    std::lock_guard guard(sync_mutex);
+    if (is_open()) {
+      return std::nullopt;
+    }
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+      return std::nullopt;
+    }
+    struct stat st;
+    char magic[sizeof(file_magic)];
+    if (::fstat(fd, &st) != 0 ||
+        (st.st_size != 0 && (::pread(fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+                             std::memcmp(magic, file_magic, sizeof(magic)) != 0)) ||
+        !_map(std::max<std::size_t>(st.st_size, initial_capacity))) {
+      close();
+      return std::nullopt;
+    }
+    if (st.st_size == 0) {
+      std::memcpy(mapped, file_magic, sizeof(file_magic));
+    }
+    version_t last_version = version_start<version_t>;
+    std::size_t offset = sizeof(file_magic);
+    while (auto header = _valid_record(offset)) {
+      last_version = header->version;
+      auto payload = offset + sizeof(record_header);
+      for (std::uint32_t i = 0; i < header->count; ++i) {
+        std::uint64_t key, size;
+        std::memcpy(&key, mapped + payload, sizeof(key));
+        std::memcpy(&size, mapped + payload + sizeof(key), sizeof(size));
+        auto bytes = reinterpret_cast<const std::byte *>(mapped + payload + 2 * sizeof(key));
+        recovered.insert_or_assign(key, std::vector<std::byte>(bytes, bytes + size));
+        payload += 2 * sizeof(key) + size;
+      }
+      offset += sizeof(record_header) + header->length;
+    }
+    // drop a torn tail, so stale records behind it can never be replayed after new appends.
+    std::memset(mapped + offset, 0, capacity - offset);
+    tail = offset;
+    synced = offset;
+    appended = last_version;
+    return last_version;
+  }
+
+  void close() {
+    if (mapped) {
+      ::munmap(mapped, capacity);
+      mapped = nullptr;
+    }
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+    recovered.clear();
+  }
+
+  bool is_open() const { return fd >= 0; }
+
+  // copies the last recovered value of key into dst.
+  bool recover(std::uint64_t key, void *dst, std::size_t size) {
+    std::lock_guard guard(sync_mutex);
+    auto found = recovered.find(key);
+    if (found == recovered.end() || found->second.size() != size) {
+      return false;
+    }
+    std::memcpy(dst, found->second.data(), size);
+    return true;
+  }
+
+  // appends the write set of write_version once all earlier versions are appended.
+  // returns the log offset that has to be synced for the record to be durable.
+  std::size_t append(version_t write_version, std::span<const log_entry> entries) {
+    if (!is_open()) {
+      return 0;
+    }
+    version_t previous;
+    while ((previous = appended.load(std::memory_order_acquire)) != write_version - 1) {
+      appended.wait(previous, std::memory_order_acquire);
+    }
+    std::size_t end = tail.load(std::memory_order_relaxed);
+    if (!entries.empty()) {
+      std::uint64_t length = 0;
+      for (auto &entry : entries) {
+        length += 2 * sizeof(std::uint64_t) + entry.bytes.size();
+      }
+      record_header header{.magic = record_magic,
+                           .checksum = 0,
+                           .version = write_version,
+                           .count = static_cast<std::uint32_t>(entries.size()),
+                           .length = length};
+      if (end + sizeof(header) + length > capacity) {
+        // a concurrent group sync must not flush a mapping that is being replaced.
+        std::lock_guard guard(sync_mutex);
+        if (!_map(std::max(2 * capacity, end + sizeof(header) + length))) {
+          std::cerr << "FATAL: could not grow redo log" << std::endl;
+          std::exit(EXIT_FAILURE);
+        }
+      }
+      auto payload = end + sizeof(header);
+      for (auto &entry : entries) {
+        std::uint64_t size = entry.bytes.size();
+        std::memcpy(mapped + payload, &entry.key, sizeof(entry.key));
+        std::memcpy(mapped + payload + sizeof(entry.key), &size, sizeof(size));
+        std::memcpy(mapped + payload + 2 * sizeof(size), entry.bytes.data(), size);
+        payload += 2 * sizeof(size) + size;
+      }
+      header.checksum = _checksum(header, end + sizeof(header));
+      std::memcpy(mapped + end, &header, sizeof(header));
+      end = payload;
+      tail.store(end, std::memory_order_release);
+    }
+    appended.store(write_version, std::memory_order_release);
+    appended.notify_all();
+    return end;
+  }
+
+  // group commit: one committer flushes everything appended so far, the others waiting
+  // behind it find their records already durable.
+  void sync(std::size_t end) {
+    if (!is_open() || synced.load(std::memory_order_acquire) >= end) {
+      return;
+    }
+    std::lock_guard guard(sync_mutex);
+    if (synced.load(std::memory_order_acquire) >= end) {
+      return;
+    }
+    auto target = tail.load(std::memory_order_acquire);
+    // records are written through the shared mapping, msync is what makes them durable.
+    auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    auto begin = synced.load(std::memory_order_relaxed) / page * page;
+    if (::msync(mapped + begin, target - begin, MS_SYNC) != 0) {
+      // a failed flush may have dropped dirty pages, nothing appended is known to be durable.
+      std::cerr << "FATAL: could not sync redo log" << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    synced.store(target, std::memory_order_release);
+  }
+
+ private:
+  struct record_header {
+    std::uint32_t magic;
+    std::uint32_t checksum;
+    version_t version;
+    std::uint32_t count;
+    std::uint64_t length;
+  };
+  static constexpr char file_magic[8] = {'S', 'T', 'M', 'X', 'X', 'L', 'O', 'G'};
+  static constexpr std::uint32_t record_magic = 0x52454330;
+  static constexpr std::size_t initial_capacity = 1 << 20;
+
+  std::uint32_t _checksum(record_header header, std::size_t payload) const {
+    header.checksum = 0;
+    auto crc = crc32(std::as_bytes(std::span(&header, 1)));
+    return crc32(std::span(reinterpret_cast<const std::byte *>(mapped + payload), header.length),
+                 crc);
+  }
+
+  std::optional<record_header> _valid_record(std::size_t offset) const {
+    record_header header;
+    if (offset + sizeof(header) > capacity) {
+      return std::nullopt;
+    }
+    std::memcpy(&header, mapped + offset, sizeof(header));
+    if (header.magic != record_magic ||
+        header.length > capacity - offset - sizeof(header) ||
+        _checksum(header, offset + sizeof(header)) != header.checksum) {
+      return std::nullopt;
+    }
+    return header;
+  }
+
+  bool _map(std::size_t size) {
+    if (mapped) {
+      ::munmap(mapped, capacity);
+      mapped = nullptr;
+    }
+    if (::ftruncate(fd, size) != 0) {
+      return false;
+    }
+    void *addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+      return false;
+    }
+    mapped = static_cast<char *>(addr);
+    capacity = size;
+    return true;
+  }
+
+  int fd = -1;
+  char *mapped = nullptr;
+  std::size_t capacity = 0;
+  std::atomic<std::size_t> tail = 0;
+  std::atomic<std::size_t> synced = 0;
+  std::atomic<version_t> appended = version_start<version_t>;
+  std::mutex sync_mutex;
+  std::unordered_map<std::uint64_t, std::vector<std::byte>> recovered;
+};
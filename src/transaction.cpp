@@ -10,22 +10,52 @@ module;
 #include <optional>
 #include <cassert>
 #include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
 export module STMXX:Transaction;
+import :Profiler;
+import :RedoLog;
 import Util;
 
-export template <typename T, long long N = 0>
+export namespace backend {
+// per-tval versioned locks, lazy conflict detection during commit.
+struct orec {};
+// single global sequence lock, value-based read validation, single-writer commit.
+struct norec {};
+// orec with committed writes of persisted tvals appended to a redo log.
+struct durable {};
+}  // namespace backend
+
+// thrown by parallel_for when workers access a tval another worker writes.
+export class parallel_conflict final : public std::logic_error {
+ public:
+  using std::logic_error::logic_error;
+};
+
+export template <typename T, long long N = 0, typename Backend = backend::orec>
 class transaction;
 
 template <typename T>
 class transaction_friend final {
  public:
   using unique_identifier = T::unique_identifier;
+  using backend_type = T::backend_type;
 };
 
 export template <typename T>
 concept Transaction = requires(T t) {
   std::same_as<typename transaction_friend<T>::unique_identifier, unique_to_lib>;
 };
+
+template <typename T>
+concept DurableTransaction =
+    Transaction<T> && std::same_as<typename transaction_friend<T>::backend_type, backend::durable>;
 class tval {
  public:
   virtual ~tval() {};
@@ -57,6 +87,55 @@ class tval {
   static inline auto &getWriteMap() {
     return Context::thread_transaction->write_map;
   }
+  // uncommitted value of tval in the current transaction or, for a parallel worker, its parents.
+  template <Transaction Context>
+  static inline const auto *findWritten(tval *tval) {
+    for (auto current = Context::thread_transaction; current; current = current->parent) {
+      auto found = current->write_map.find(tval);
+      if (found != current->write_map.end()) {
+        return found->second.get();
+      }
+    }
+    return decltype(Context::thread_transaction->write_map.begin()->second.get())(nullptr);
+  }
+  template <Transaction Context>
+  static inline const auto *findLogged(tval *tval) {
+    for (auto current = Context::thread_transaction; current; current = current->parent) {
+      auto found = current->read_set.find(tval);
+      if (found != current->read_set.end()) {
+        return found->second.get();
+      }
+    }
+    return decltype(Context::thread_transaction->read_set.begin()->second.get())(nullptr);
+  }
+  // a parallel worker records every read, also those served by the logs of its parents.
+  template <Transaction Context>
+  static inline void recordWorkerRead(tval *tval) {
+    auto current = Context::thread_transaction;
+    if (current->parent) {
+      current->worker_reads.insert(tval);
+    }
+  }
+  template <Transaction Context>
+  static constexpr bool isValueValidated() {
+    return std::same_as<typename Context::backend_type, backend::norec>;
+  }
+  template <Transaction Context>
+  static inline auto &getGlobalVersion() {
+    return Context::global_version;
+  }
+  template <Transaction Context>
+  static inline bool extendSnapshot(const tval *reading) {
+    return Context::thread_transaction->_extend(abort_site::read, reading);
+  }
+  template <Transaction Context>
+  static inline void setConflict(const tval *conflict, abort_site site) {
+    Context::thread_transaction->_set_conflict(conflict, site);
+  }
+  template <Transaction Context>
+  static inline redo_log &getLog() {
+    return Context::durable_log;
+  }
 };
 bool check_tval_version(tval &tval, version_t read_version) {
   return tval._check_version(read_version);
@@ -67,91 +146,290 @@ class written {
   virtual const void *get() const = 0;
   virtual std::optional<version_t> try_lock() = 0;
   virtual bool try_set(version_t write_version) && = 0;
+  virtual void write_back() && = 0;
+  virtual std::optional<log_entry> durable_entry() const = 0;
 
  protected:
   written() {}
 };
-export template <typename T, long long N = 0>
-class transaction {
-  // read set
-  // write set
-  // read version
-  transaction(transaction<T, N> &other) = delete;
+class logged {
+ public:
+  virtual ~logged() {};
+  virtual const void *get() const = 0;
+  virtual bool comparable() const = 0;
+  virtual bool validate() const = 0;
+
+ protected:
+  logged() {}
+};
 
+// entry points and attempt state shared by all backends. Context provides a constructor at its
+// current snapshot, its read_set and _commit.
+template <typename Context>
+class transaction_base {
  public:
   template <std::invocable F>
-  static auto start(F &&f) -> std::invoke_result<F>::type;
+  static auto start(F &&f) -> std::invoke_result<F>::type {
+    return *start_until(std::chrono::steady_clock::time_point::max(), std::forward<F>(f));
+  }
 
- private:
-  using unique_identifier = unique_to_lib;
-  transaction() : read_version(global_version.load(std::memory_order_acquire)) {};
-  friend class tval;
+  // like start, but no attempt is started once deadline has passed. returns std::nullopt if the
+  // transaction did not commit in time.
+  template <typename Clock, typename Duration, std::invocable F>
+  static auto start_until(const std::chrono::time_point<Clock, Duration> &deadline, F &&f)
+      -> std::optional<typename std::invoke_result<F>::type>;
 
-  template <typename S>
-  friend class transaction_friend;
+  template <typename Rep, typename Period, std::invocable F>
+  static auto start_for(const std::chrono::duration<Rep, Period> &budget, F &&f)
+      -> std::optional<typename std::invoke_result<F>::type> {
+    return start_until(std::chrono::steady_clock::now() + budget, std::forward<F>(f));
+  }
 
-  inline static thread_local transaction<T, N> *thread_transaction = nullptr;
-  inline static std::atomic<version_t> global_version = version_start<version_t>;
+  // runs fn(i) for every i in [begin, end) on worker threads as part of the current transaction,
+  // or of a new one when called outside of a transaction.
+  template <typename F>
+    requires std::invocable<F &, std::size_t>
+  static void parallel_for(std::size_t begin, std::size_t end, F &&fn,
+                           unsigned workers = std::thread::hardware_concurrency()) {
+    if (!Context::thread_transaction) {
+      start([&] {
+        parallel_for(begin, end, fn, workers);
+        return 0;
+      });
+    } else {
+      _fork_join(*Context::thread_transaction, begin, end, fn, workers);
+    }
+  }
+
+ protected:
+  explicit transaction_base(version_t read_version) : read_version(read_version) {}
+  // shard of a parallel worker, reads at the snapshot of parent.
+  explicit transaction_base(Context *parent)
+      : read_version(parent->read_version.load(std::memory_order_relaxed)), parent(parent) {}
+
+  void _set_conflict(const tval *conflicting, abort_site site) {
+    if (!conflict.tval) {
+      conflict = {.tval = dynamic_cast<const void *>(conflicting), .site = site};
+    }
+  }
+
+  inline static thread_local Context *thread_transaction = nullptr;
 
   std::atomic<version_t> read_version;
+  Context *parent = nullptr;
   bool failed = false;
-  std::unordered_set<tval *> read_set;
+  conflict_info conflict;
   std::unordered_map<tval *, std::unique_ptr<written>> write_map;
+  // every tval a parallel worker read, also those served by the logs of its parents.
+  std::unordered_set<tval *> worker_reads;
+
+ private:
+  template <typename F>
+  static void _fork_join(Context &parent, std::size_t begin, std::size_t end, F &fn,
+                         unsigned workers);
 };
 
-template <typename T, long long N>
-template <std::invocable F>
-auto transaction<T, N>::start(F &&f) -> std::invoke_result<F>::type {
+template <typename Context>
+template <typename Clock, typename Duration, std::invocable F>
+auto transaction_base<Context>::start_until(
+    const std::chrono::time_point<Clock, Duration> &deadline, F &&f)
+    -> std::optional<typename std::invoke_result<F>::type> {
   typename std::invoke_result<F>::type result;
 
-  if (!thread_transaction) {
-  retry:
+  if (!Context::thread_transaction) {
+    // also detaches the transaction when f throws.
+    struct detach {
+      ~detach() { Context::thread_transaction = nullptr; }
+    } detach_on_exit;
     do {
-      transaction<T, N> alloc;
-      thread_transaction = &alloc;
-      alloc.failed = false;
-      result = f();
-      std::unordered_map<tval *, version_t> owned_versions;
-      if (!alloc.failed) {
-        // lock all written values
-        for (auto &[key, written] : alloc.write_map) {
-          auto maybe_version = written->try_lock();
-          if (!maybe_version) {
-            goto retry;
-          }
-          owned_versions.insert_or_assign(key, maybe_version.value());
-        }
-        // check if read set is current
-        for (auto &read : alloc.read_set) {
-          auto [first, last] = owned_versions.equal_range(read);
-          auto view = std::ranges::subrange(first, last);
-          auto maybe_owned = std::ranges::empty(view)
-                                 ? std::nullopt
-                                 : std::optional((view | std::views::values).front());
-          if (!maybe_owned
-                   .transform([&alloc](auto &version) { return version <= alloc.read_version; })
-                   .value_or(check_tval_version(*read, alloc.read_version))) {
-            goto retry;
-          }
-        }
-        // update write version
-        auto write_version =
-            std::atomic_fetch_add_explicit(&global_version, 1, std::memory_order::acq_rel) + 1;
-        // update written values and unlock
-        for (auto &written : alloc.write_map | std::views::values) {
-          if (!std::move(*written).try_set(write_version)) {
-            assert(false);
-            goto retry;
-          }
-        }
+      if (deadline != deadline.max() && Clock::now() >= deadline) {
+        return std::nullopt;
       }
-      if (!alloc.failed) {
+      Context alloc;
+      profiled_attempt attempt(alloc.conflict);
+      Context::thread_transaction = &alloc;
+      result = f();
+      if (!alloc.failed && alloc._commit()) {
+        attempt.committed();
         break;
       }
     } while (true);
-    thread_transaction = nullptr;
   } else {
     result = f();
   }
   return result;
+}
+
+// runs fn over [begin, end) on worker threads inside parent. every worker gets its own shard
+// transaction at the snapshot of parent, shards are merged into parent once all workers finished.
+// workers do not see each other's writes, so a tval written by one worker may not be read or
+// written by another one.
+template <typename Context>
+template <typename F>
+void transaction_base<Context>::_fork_join(Context &parent, std::size_t begin, std::size_t end,
+                                           F &fn, unsigned workers) {
+  if (parent.failed || begin >= end) {
+    return;
+  }
+  workers = static_cast<unsigned>(std::clamp<std::size_t>(workers, 1, end - begin));
+  auto chunk = (end - begin + workers - 1) / workers;
+  std::vector<std::unique_ptr<Context>> shards;
+  std::vector<std::exception_ptr> errors(workers);
+  std::vector<std::thread> threads;
+  for (unsigned worker = 0; worker < workers; ++worker) {
+    shards.emplace_back(new Context(&parent));
+    threads.emplace_back([&, worker, shard = shards.back().get()] {
+      Context::thread_transaction = shard;
+      try {
+        auto last = std::min(end, begin + (worker + 1) * chunk);
+        for (auto i = begin + worker * chunk; i < last && !shard->failed; ++i) {
+          fn(i);
+        }
+      } catch (...) {
+        errors[worker] = std::current_exception();
+      }
+      Context::thread_transaction = nullptr;
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  // a failed worker may have thrown on an inconsistent snapshot, the attempt is retried instead.
+  for (auto &shard : shards) {
+    if (shard->failed) {
+      parent.failed = true;
+      if (!parent.conflict.tval) {
+        parent.conflict = shard->conflict;
+      }
+    }
+  }
+  if (parent.failed) {
+    return;
+  }
+  for (auto &error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+  // a retry splits the range the same way, so overlapping workers are an error.
+  for (auto &shard : shards) {
+    for (auto &other : shards) {
+      if (shard == other) {
+        continue;
+      }
+      for (auto *written : shard->write_map | std::views::keys) {
+        if (other->worker_reads.contains(written) || other->write_map.contains(written)) {
+          throw parallel_conflict(
+              "parallel_for: a tval written by one worker is accessed by another worker");
+        }
+      }
+    }
+  }
+  for (auto &shard : shards) {
+    parent.read_set.merge(shard->read_set);
+    // parent may be a worker itself.
+    parent.worker_reads.merge(shard->worker_reads);
+    for (auto &[tval, written] : shard->write_map) {
+      parent.write_map.insert_or_assign(tval, std::move(written));
+    }
+  }
+}
+
+export template <typename T, long long N, typename Backend>
+class transaction : public transaction_base<transaction<T, N, Backend>> {
+  static_assert(std::same_as<Backend, backend::orec> || std::same_as<Backend, backend::durable>);
+  // read set
+  // write set
+  // read version
+  transaction(transaction &other) = delete;
+
+ public:
+  // maps the redo log at path and continues versioning after its last record. has to be called
+  // before the first transaction of this type, persisted tvals restore their value afterwards.
+  // refused while a log is open, and once versions past the last record were handed out.
+  static bool open_log(const std::filesystem::path &path)
+    requires std::same_as<Backend, backend::durable>
+  {
+    auto last_version = durable_log.open(path);
+    if (!last_version) {
+      return false;
+    }
+    if (global_version.load(std::memory_order_acquire) > *last_version) {
+      durable_log.close();
+      return false;
+    }
+    global_version = *last_version;
+    return true;
+  }
+
+ private:
+  using unique_identifier = unique_to_lib;
+  using backend_type = Backend;
+  transaction()
+      : transaction_base<transaction>(global_version.load(std::memory_order_acquire)) {};
+  using transaction_base<transaction>::transaction_base;
+  friend class tval;
+  friend class transaction_base<transaction>;
+
+  template <typename S>
+  friend class transaction_friend;
+
+  inline static std::atomic<version_t> global_version = version_start<version_t>;
+  inline static redo_log durable_log;
+
+  bool _commit();
+
+  std::unordered_set<tval *> read_set;
+};
+
+template <typename T, long long N, typename Backend>
+bool transaction<T, N, Backend>::_commit() {
+  std::unordered_map<tval *, version_t> owned_versions;
+  // lock all written values
+  for (auto &[key, written] : this->write_map) {
+    auto maybe_version = written->try_lock();
+    if (!maybe_version) {
+      this->_set_conflict(key, abort_site::commit_lock);
+      return false;
+    }
+    owned_versions.insert_or_assign(key, maybe_version.value());
+  }
+  // check if read set is current
+  for (auto &read : read_set) {
+    auto [first, last] = owned_versions.equal_range(read);
+    auto view = std::ranges::subrange(first, last);
+    auto maybe_owned = std::ranges::empty(view)
+                           ? std::nullopt
+                           : std::optional((view | std::views::values).front());
+    if (!maybe_owned.transform([this](auto &version) { return version <= this->read_version; })
+             .value_or(check_tval_version(*read, this->read_version))) {
+      this->_set_conflict(read, abort_site::commit_validate);
+      return false;
+    }
+  }
+  // update write version
+  auto write_version =
+      std::atomic_fetch_add_explicit(&global_version, 1, std::memory_order::acq_rel) + 1;
+  // log persisted writes in write version order
+  std::size_t log_end = 0;
+  if constexpr (std::same_as<Backend, backend::durable>) {
+    std::vector<log_entry> entries;
+    for (auto &written : this->write_map | std::views::values) {
+      if (auto entry = written->durable_entry()) {
+        entries.push_back(*entry);
+      }
+    }
+    log_end = durable_log.append(write_version, entries);
+  }
+  // update written values and unlock
+  for (auto &written : this->write_map | std::views::values) {
+    if (!std::move(*written).try_set(write_version)) {
+      assert(false);
+      return false;
+    }
+  }
+  if constexpr (std::same_as<Backend, backend::durable>) {
+    durable_log.sync(log_end);
+  }
+  return true;
 }
\ No newline at end of file
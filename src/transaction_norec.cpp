@@ -0,0 +1,130 @@
+module;
+#include <memory>
+#include <ranges>
+#include <type_traits>
+#include <concepts>
+#include <utility>
+#include <unordered_map>
+#include <atomic>
+#include <optional>
+#include <cassert>
+#include <cstdlib>
+export module STMXX:TransactionNOrec;
+import :Profiler;
+import :Transaction;
+import Util;
+
+template <typename T, long long N>
+class transaction<T, N, backend::norec>
+    : public transaction_base<transaction<T, N, backend::norec>> {
+  // read log: value of every tval at its first read
+  // write set
+  // read version: even snapshot of the global sequence lock
+  transaction(transaction &other) = delete;
+
+  using unique_identifier = unique_to_lib;
+  using backend_type = backend::norec;
+  transaction() : transaction_base<transaction>(_snapshot()) {};
+  using transaction_base<transaction>::transaction_base;
+  friend class tval;
+  friend class transaction_base<transaction>;
+
+  template <typename S>
+  friend class transaction_friend;
+
+  static version_t _snapshot();
+  // nullopt if no logged value changed, else the changed tval or nullptr if it is unknown.
+  std::optional<const tval *> _changed() const;
+  bool _extend(abort_site site, const tval *reading = nullptr);
+  bool _commit();
+
+  // sequence lock: odd while a writer commits. under THREAD_SANITIZER also while a reader copies
+  // or validates values.
+  inline static std::atomic<version_t> global_version = version_start<version_t>;
+
+  std::unordered_map<tval *, std::unique_ptr<logged>> read_set;
+};
+
+template <typename T, long long N>
+version_t transaction<T, N, backend::norec>::_snapshot() {
+  version_t version;
+  while ((version = global_version.load(std::memory_order_acquire)) & 1) {
+  }
+  return version;
+}
+
+template <typename T, long long N>
+std::optional<const tval *> transaction<T, N, backend::norec>::_changed() const {
+  std::optional<const tval *> changed;
+  for (auto &[read, logged] : read_set) {
+    if (!logged->comparable()) {
+      // may have changed with any commit, nothing to charge it to.
+      changed = nullptr;
+    } else if (!logged->validate()) {
+      return read;
+    }
+  }
+  return changed;
+}
+
+template <typename T, long long N>
+bool transaction<T, N, backend::norec>::_extend(abort_site site, const tval *reading) {
+  // a parallel worker cannot move the snapshot it shares with its parent.
+  if (this->parent) {
+    if (reading) {
+      this->_set_conflict(reading, site);
+    }
+    return false;
+  }
+  std::optional<const tval *> changed;
+  version_t version;
+#if THREAD_SANITIZER
+  // validate under the sequence lock, the thread sanitizer can't see a torn compare is retried.
+  version = _snapshot();
+  while (!global_version.compare_exchange_weak(version, version + 1, std::memory_order_acq_rel)) {
+    version = _snapshot();
+  }
+  // only readers held the lock since the snapshot.
+  if (version != this->read_version) {
+    changed = _changed();
+  }
+  global_version.store(version, std::memory_order_release);
+#else
+  do {
+    version = _snapshot();
+    if (version == this->read_version) {
+      return true;
+    }
+    changed = _changed();
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while (global_version.load(std::memory_order_relaxed) != version);
+#endif
+  if (changed) {
+    if (*changed) {
+      this->_set_conflict(*changed, site);
+    }
+    return false;
+  }
+  this->read_version = version;
+  return true;
+}
+
+template <typename T, long long N>
+bool transaction<T, N, backend::norec>::_commit() {
+  // read only: every read was consistent at read_version.
+  if (this->write_map.empty()) {
+    return true;
+  }
+  version_t version = this->read_version;
+  while (!global_version.compare_exchange_weak(version, version + 1, std::memory_order_acq_rel)) {
+    if (!_extend(abort_site::commit_validate)) {
+      return false;
+    }
+    version = this->read_version;
+  }
+  for (auto &written : this->write_map | std::views::values) {
+    std::move(*written).write_back();
+  }
+  global_version.store(version + 2, std::memory_order_release);
+  return true;
+}
@@ -1,5 +1,8 @@
 module;
 #include <memory>
+#include <cstdint>
+#include <span>
+#include <variant>
 #include <type_traits>
 #include <concepts>
 #include <utility>
@@ -7,6 +10,7 @@ module;
 #include <optional>
 #include <cassert>
 #include <cstdlib>
+#include <exception>
 #include <iostream>
 #include <ostream>
 export module STMXX:TransactionVal;
@@ -15,6 +19,68 @@ import Util;
 
 export template <std::copyable T, Transaction Context>
 class transaction_t;
+// committed value of a tval. trivially copyable values live in place, a torn read fails version
+// validation. other values are immutable once committed and swapped by pointer: a reader keeps
+// the value it visits alive, it is freed with its last reader.
+template <std::copyable T>
+class committed_value final {
+ public:
+  static constexpr bool in_place = std::is_trivially_copyable_v<T>;
+  using pinned = std::conditional_t<in_place, const T *, std::shared_ptr<const T>>;
+
+  explicit committed_value(T &&val) : value(_make(std::move(val))) {}
+  committed_value(committed_value &other) = delete;
+
+  pinned pin() const {
+    if constexpr (in_place) {
+      return &value;
+    } else {
+      _lock();
+      pinned current = value;
+      _unlock();
+      return current;
+    }
+  }
+  void store(T &&val) {
+    if constexpr (in_place) {
+      value = std::move(val);
+    } else {
+      pinned next = _make(std::move(val));
+      _lock();
+      value.swap(next);
+      _unlock();
+    }
+  }
+  T *data()
+    requires in_place
+  {
+    return &value;
+  }
+
+ private:
+  static auto _make(T &&val) {
+    if constexpr (in_place) {
+      return std::move(val);
+    } else {
+      return std::make_shared<const T>(std::move(val));
+    }
+  }
+  // only held to copy or swap the pointer, never while a value is visited or freed.
+  void _lock() const {
+    while (swapping.test_and_set(std::memory_order_acquire)) {
+      swapping.wait(true, std::memory_order_relaxed);
+    }
+  }
+  void _unlock() const {
+    swapping.clear(std::memory_order_release);
+    swapping.notify_one();
+  }
+
+  std::conditional_t<in_place, T, std::shared_ptr<const T>> value;
+  [[no_unique_address]] mutable std::conditional_t<in_place, std::monostate, std::atomic_flag>
+      swapping;
+};
+
 template <typename T, Transaction Context>
 class written_t final : public written {
  public:
@@ -32,12 +98,64 @@ class written_t final : public written {
     }
     return false;
   }
+  void write_back() && { to_set.write_val(std::move(t)); }
+  std::optional<log_entry> durable_entry() const {
+    if constexpr (DurableTransaction<Context> && std::is_trivially_copyable_v<T>) {
+      return to_set.durable_key.transform([this](auto key) {
+        return log_entry{.key = key, .bytes = std::as_bytes(std::span(&t, 1))};
+      });
+    } else {
+      return std::nullopt;
+    }
+  }
 
  private:
   T t;
   transaction_t<T, Context> &to_set;
   std::optional<typename transaction_t<T, Context>::transaction_lock> lock = std::nullopt;
 };
+template <typename T, Transaction Context>
+class logged_t final : public logged {
+  static constexpr bool in_place = committed_value<T>::in_place;
+
+ public:
+  // values in place are copied, others share the committed value.
+  using snapshot = std::conditional_t<in_place, T, typename committed_value<T>::pinned>;
+
+  logged_t(snapshot &&val, const transaction_t<T, Context> &to_check)
+      : t(std::move(val)), to_check(to_check) {}
+  const void *get() const {
+    if constexpr (in_place) {
+      return &t;
+    } else {
+      return t.get();
+    }
+  }
+  bool comparable() const { return std::equality_comparable<T> || !in_place; }
+  bool validate() const {
+    auto current = to_check.value.pin();
+    if constexpr (!in_place) {
+      // every commit swaps the pointer, the same pointer is the same value.
+      if (current == t) {
+        return true;
+      }
+      if constexpr (std::equality_comparable<T>) {
+        return *current == *t;
+      } else {
+        return false;
+      }
+    } else if constexpr (std::equality_comparable<T>) {
+      return *current == t;
+    } else {
+      // without value equality every concurrent commit invalidates the read.
+      return false;
+    }
+  }
+
+ private:
+  const snapshot t;
+  const transaction_t<T, Context> &to_check;
+};
 
 export template <std::copyable T, Transaction Context>
 class transaction_t final : public tval {
@@ -82,9 +200,9 @@ class transaction_t final : public tval {
     bool is_locked;
   };
   template <typename... U>
-  transaction_t(U &&...args) : t(T(std::forward<U>(args)...)) {}
+  transaction_t(U &&...args) : value(T(std::forward<U>(args)...)) {}
 
-  transaction_t(T &&t) : t(std::move(t)) {}
+  transaction_t(T &&t) : value(std::move(t)) {}
 
   transaction_t(transaction_t<T, Context> &other) = delete;
 
@@ -94,7 +212,7 @@ class transaction_t final : public tval {
     if (getCurrentTransaction<Context>()) {
       return get_val(getReadVersion<Context>());
     } else {
-      return t;
+      return *value.pin();
     }
   }
 
@@ -109,7 +227,7 @@ class transaction_t final : public tval {
     if (getCurrentTransaction<Context>()) {
       return get_member(objptr, getReadVersion<Context>());
     } else {
-      return t.*objptr;
+      return (*value.pin()).*objptr;
     }
   }
 
@@ -120,11 +238,41 @@ class transaction_t final : public tval {
       if (getCurrentTransaction<Context>()) {
         return call_accessor(getReadVersion<Context>(), objptr, args...);
       } else {
-        return std::optional((t.*objptr)(args...));
+        return std::optional(((*value.pin()).*objptr)(args...));
       }
     };
   }
 
+  // zero-copy read: fn inspects the value in place and only its result is copied out. inside a
+  // transaction fn may observe a torn trivially copyable value; its result, or anything it throws,
+  // is discarded unless the read validates like any other read. other values are immutable once
+  // committed, fn visits one that stays alive until it returns.
+  template <typename Fn>
+    requires std::invocable<Fn, const T &> &&
+             (!std::is_void_v<std::invoke_result_t<Fn, const T &>>)
+  auto read(Fn &&fn) const
+      -> std::optional<std::remove_cvref_t<std::invoke_result_t<Fn, const T &>>> {
+    using V = std::remove_cvref_t<std::invoke_result_t<Fn, const T &>>;
+    if (!getCurrentTransaction<Context>()) {
+      return fn(*value.pin());
+    }
+    std::exception_ptr error;
+    auto result = issue_read_op<std::optional<V>>(
+        [&](const T *ptr) -> std::optional<V> {
+          try {
+            return fn(*ptr);
+          } catch (...) {
+            error = std::current_exception();
+            return std::nullopt;
+          }
+        },
+        getReadVersion<Context>());
+    if (result && error) {
+      std::rethrow_exception(error);
+    }
+    return result.value_or(std::nullopt);
+  }
+
   template <typename U>
   transaction_t<T, Context> &operator=(U &&val) {
     if (getCurrentTransaction<Context>()) {
@@ -133,11 +281,20 @@ class transaction_t final : public tval {
             this, std::make_unique<written_t<T, Context>>(written_t(std::forward<U>(val), *this)));
       }
     } else {
-      t = std::forward<T>(val);
+      value.store(T(std::forward<U>(val)));
     }
     return *this;
   }
 
+  // restores the last value committed under key from the redo log and logs all later commits.
+  // call once after Context::open_log, before the tval is shared.
+  bool persist(std::uint64_t key)
+    requires DurableTransaction<Context> && std::is_trivially_copyable_v<T>
+  {
+    durable_key = key;
+    return getLog<Context>().recover(key, value.data(), sizeof(T));
+  }
+
  private:
   static constexpr void _static_checks() noexcept;
 
@@ -152,42 +309,108 @@ class transaction_t final : public tval {
     return res;
   }
 
-  const T *_get_ptr_in_transaction() const {
-    assert(getCurrentTransaction<Context>());
-    auto non_committed_val = getWriteMap<Context>().find(const_cast<transaction_t *>(this));
-    return non_committed_val != getWriteMap<Context>().end()
-               ? static_cast<const T *>(non_committed_val->second->get())
-               : &t;
+  typename logged_t<T, Context>::snapshot _log_snapshot() const {
+    if constexpr (committed_value<T>::in_place) {
+      return *value.pin();
+    } else {
+      return value.pin();
+    }
   }
 
   template <typename V, typename Fn>
     requires std::is_invocable_r<V, Fn, T *>::value
-  const std::optional<V> issue_read_op(Fn accessor, version_t read_version) const {
+  const std::optional<V> issue_logged_read_op(Fn accessor) const {
     assert(getCurrentTransaction<Context>());
-    // check read_version twice: first check for memory order acquire. second read_version for
-    // consistency guarantee. data race is possible, but any data race must also update read
-    // version, making the second test fail.
-    if (!getFailed<Context>() && _check_version(read_version)) {
-// don't register data race by thread sanitizer
+    auto self = const_cast<transaction_t<T, Context> *const>(this);
+    if (getFailed<Context>()) {
+      return std::nullopt;
+    }
+    auto non_committed_val = findWritten<Context>(self);
+    if (non_committed_val) {
+      return accessor(static_cast<const T *>(non_committed_val->get()));
+    }
+    // the logged copy was validated against the current snapshot, later reads use it directly.
+    const logged *logged_val = findLogged<Context>(self);
+    if (!logged_val) {
+      std::unique_ptr<logged_t<T, Context>> copy;
+// don't register data race by thread sanitizer, values swapped by pointer cannot race
 #if THREAD_SANITIZER
-      std::optional<transaction_lock> lock;
-      lock = ((transaction_t *)this)->try_lock();
-      if (!lock) {
-        return std::nullopt;
-      }
+      constexpr bool locked_copy = committed_value<T>::in_place;
+#else
+      constexpr bool locked_copy = false;
 #endif
-      std::optional<V> result = accessor(_get_ptr_in_transaction());
+      if constexpr (locked_copy) {
+        // copy under the sequence lock, committers cannot write meanwhile.
+        auto &global_version = getGlobalVersion<Context>();
+        version_t version = getReadVersion<Context>();
+        while (!global_version.compare_exchange_strong(version, version + 1,
+                                                       std::memory_order_acq_rel)) {
+          // held at our snapshot: wait for it instead of revalidating.
+          if (version != getReadVersion<Context>() + 1 && !extendSnapshot<Context>(this)) {
+            getFailed<Context>() = true;
+            return std::nullopt;
+          }
+          version = getReadVersion<Context>();
+        }
+        copy = std::make_unique<logged_t<T, Context>>(_log_snapshot(), *this);
+        global_version.store(version, std::memory_order_release);
+      } else {
+        copy = std::make_unique<logged_t<T, Context>>(_log_snapshot(), *this);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        while (getGlobalVersion<Context>().load(std::memory_order_relaxed) !=
+               getReadVersion<Context>()) {
+          if (!extendSnapshot<Context>(this)) {
+            getFailed<Context>() = true;
+            return std::nullopt;
+          }
+          copy = std::make_unique<logged_t<T, Context>>(_log_snapshot(), *this);
+          std::atomic_thread_fence(std::memory_order_acquire);
+        }
+      }
+      logged_val = getReadSet<Context>().emplace(self, std::move(copy)).first->second.get();
+    }
+    return accessor(static_cast<const T *>(logged_val->get()));
+  }
+
+  template <typename V, typename Fn>
+    requires std::is_invocable_r<V, Fn, T *>::value
+  const std::optional<V> issue_read_op(Fn accessor, version_t read_version) const {
+    assert(getCurrentTransaction<Context>());
+    recordWorkerRead<Context>(const_cast<transaction_t<T, Context> *const>(this));
+    if constexpr (isValueValidated<Context>()) {
+      return issue_logged_read_op<V>(accessor);
+    } else {
+      // check read_version twice: first check for memory order acquire. second read_version for
+      // consistency guarantee. data race is possible, but any data race must also update read
+      // version, making the second test fail.
+// don't register data race by thread sanitizer, values swapped by pointer cannot race
 #if THREAD_SANITIZER
-      if (lock->getVersion() <= read_version) {
+      constexpr bool exclusive = committed_value<T>::in_place;
 #else
-      if (_check_version(read_version)) {
+      constexpr bool exclusive = false;
 #endif
-        getReadSet<Context>().insert(const_cast<transaction_t<T, Context> *const>(this));
-        return result;
+      if (!getFailed<Context>() && _check_version(read_version)) {
+        std::optional<transaction_lock> lock;
+        if constexpr (exclusive) {
+          lock = ((transaction_t *)this)->try_lock();
+          if (!lock) {
+            setConflict<Context>(this, abort_site::read);
+            return std::nullopt;
+          }
+        }
+        auto pinned = value.pin();
+        auto non_committed_val = findWritten<Context>(const_cast<transaction_t *>(this));
+        std::optional<V> result = accessor(
+            non_committed_val ? static_cast<const T *>(non_committed_val->get()) : &*pinned);
+        if (exclusive ? lock->getVersion() <= read_version : _check_version(read_version)) {
+          getReadSet<Context>().insert(const_cast<transaction_t<T, Context> *const>(this));
+          return result;
+        }
       }
+      setConflict<Context>(this, abort_site::read);
+      getFailed<Context>() = true;
+      return std::nullopt;
     }
-    getFailed<Context>() = true;
-    return std::nullopt;
   }
 
   template <typename S>
@@ -208,12 +431,17 @@ class transaction_t final : public tval {
   }
 
   friend written_t<T, Context>;
+  friend logged_t<T, Context>;
   void set_val(T &&val, version_t write_version, transaction_lock lock) {
-    t = std::forward<T>(val);
+    value.store(std::forward<T>(val));
     lock.set_version(write_version);
   }
+  // caller holds the global sequence lock.
+  void write_val(T &&val) { value.store(std::forward<T>(val)); }
 
-  T t;
+  committed_value<T> value;
+  [[no_unique_address]] std::conditional_t<DurableTransaction<Context>, std::optional<std::uint64_t>,
+                                           std::monostate> durable_key;
   // lock: atomic read version
   //
   std::atomic<std::optional<version_t>> version = std::optional(version_start<version_t>);
@@ -1,11 +1,22 @@
 module;
 #include <ranges>
 #include <algorithm>
+#include <array>
+#include <numeric>
+#include <stdexcept>
 #include <functional>
+#include <memory>
 #include <atomic>
 #include <thread>
 #include <utility>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
 #include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_template_test_macros.hpp>
 #include <catch2/generators/catch_generators_all.hpp>
 export module Test;
 import STMXX;
@@ -334,3 +345,619 @@ TEST_CASE("New allocated tval") {
     t.join();
   }
 }
+
+TEST_CASE("NOrec multi threaded basic case.") {
+  auto sleep_for = GENERATE(take(10, chunk(THREADS, random(0, 3))));
+  using T = transaction<int, 11, backend::norec>;
+  std::vector<std::thread> threads;
+  transaction_t<long long unsigned, T> tval = 0;
+  for (int i = 0; i < THREADS; ++i) {
+    threads.emplace_back([&, i] {
+      T::start([&] {
+        const auto val = *tval;
+        std::this_thread::sleep_for(std::chrono::milliseconds(sleep_for[i]));
+        if (val) {
+          modify_tval(&tval, *val + 1);
+        }
+        return 0;
+      });
+    });
+  }
+
+  for (auto &t : threads) {
+    t.join();
+  }
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  REQUIRE(**tval == THREADS);
+}
+
+TEST_CASE("NOrec class member access multi threaded.") {
+  // no operator==: validation falls back to aborting on any concurrent commit.
+  struct MyClass {
+    long long unsigned x;
+    long long unsigned y;
+  };
+
+  using T = transaction<int, 12, backend::norec>;
+
+  auto sleep_for = GENERATE(take(10, chunk(THREADS, random(0, 3))));
+  transaction_t<MyClass, T> tval = {};
+
+  std::vector<std::thread> threads;
+
+  for (int i = 0; i < THREADS; i++) {
+    threads.emplace_back([&, i] {
+      return T::start([&] {
+        auto xval = tval->*&MyClass::x;
+        std::this_thread::sleep_for(std::chrono::milliseconds(sleep_for[i]));
+        if (xval) {
+          tval = (MyClass){.x = *xval + 1, .y = *xval * 2};
+        }
+        return 0;
+      });
+    });
+  }
+  std::ranges::for_each(threads, [](auto &thread) { thread.join(); });
+
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  REQUIRE((**tval).x == THREADS);
+  REQUIRE((**tval).y == THREADS * 2 - 2);
+}
+
+TEST_CASE("NOrec readers do not abort each other.") {
+  // no operator==: only a commit may invalidate it.
+  struct Pair {
+    long long unsigned x;
+    long long unsigned y;
+  };
+  using T = transaction<int, 27, backend::norec>;
+  using Vector = std::vector<long long unsigned>;
+  transaction_t<Vector, T> vec = Vector(1 << 18, 1);
+  transaction_t<Pair, T> pair = Pair{.x = 1, .y = 2};
+
+  std::atomic<int> attempts = 0;
+  std::atomic<bool> FAILED = false;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < 100; ++j) {
+        T::start([&] {
+          ++attempts;
+          auto sum = vec.read([](const Vector &v) { return std::reduce(v.begin(), v.end()); });
+          auto x = pair->*&Pair::x;
+          if (sum && x && *sum * *x != 1 << 18) {
+            FAILED = true;
+          }
+          return 0;
+        });
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  REQUIRE(!FAILED);
+  REQUIRE(attempts == 400);
+}
+
+TEST_CASE("NOrec multi threaded sequential consistency") {
+  using T = transaction<int, 13, backend::norec>;
+
+  transaction_t<long long unsigned, T> tval1 = 0;
+  transaction_t<long long unsigned, T> tval2 = 1;
+  std::atomic<bool> FAILED = false;
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < THREADS; ++i) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < 10; ++j) {
+        T::start([&] {
+          auto val1 = *tval1;
+          auto val2 = *tval2;
+          if (val1 && val2) {
+            if (*val1 == *val2) {
+              FAILED = true;
+            }
+            tval1 = static_cast<long long unsigned>(!*val1);
+            tval2 = static_cast<long long unsigned>(!*val2);
+          }
+          return 0;
+        });
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  REQUIRE(!FAILED);
+  REQUIRE(**tval1 == 0);
+  REQUIRE(**tval2 == 1);
+}
+
+TEST_CASE("Durable transactions recover from the redo log.") {
+  using T = transaction<int, 14, backend::durable>;
+  auto path = std::filesystem::temp_directory_path() / "stmxx_durable_test.log";
+  std::filesystem::remove(path);
+
+  REQUIRE(T::open_log(path));
+  {
+    transaction_t<long long unsigned, T> tval = 0;
+    transaction_t<long long unsigned, T> volatile_tval = 0;
+    REQUIRE(!tval.persist(1));
+    std::vector<std::thread> threads;
+    for (int i = 0; i < THREADS; ++i) {
+      threads.emplace_back([&] {
+        T::start([&] {
+          auto val = *tval;
+          auto val2 = *volatile_tval;
+          if (val && val2) {
+            modify_tval(&tval, *val + 1);
+            modify_tval(&volatile_tval, *val2 + 1);
+          }
+          return 0;
+        });
+      });
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    REQUIRE(**tval == THREADS);
+
+    // a live log is neither reopened nor detached.
+    REQUIRE(!T::open_log(path));
+    T::start([&] {
+      tval = static_cast<long long unsigned>(THREADS + 1);
+      return 0;
+    });
+  }
+
+  // a fresh transaction type replays the log as on startup.
+  using U = transaction<int, 20, backend::durable>;
+  REQUIRE(U::open_log(path));
+  transaction_t<long long unsigned, U> recovered = 0;
+  REQUIRE(recovered.persist(1));
+  REQUIRE(**recovered == THREADS + 1);
+  transaction_t<long long unsigned, U> unknown = 7;
+  REQUIRE(!unknown.persist(2));
+  REQUIRE(**unknown == 7);
+  std::filesystem::remove(path);
+
+  // versions handed out before the log is opened would be reused.
+  using V = transaction<int, 28, backend::durable>;
+  transaction_t<long long unsigned, V> volatile_tval = 0;
+  V::start([&] {
+    volatile_tval = 1ull;
+    return 0;
+  });
+  REQUIRE(!V::open_log(path));
+  std::filesystem::remove(path);
+
+  // a file that is not a redo log is left alone.
+  using W = transaction<int, 29, backend::durable>;
+  {
+    std::ofstream out(path);
+    out << "not a redo log";
+  }
+  REQUIRE(!W::open_log(path));
+  {
+    std::ifstream in(path);
+    REQUIRE(std::string(std::istreambuf_iterator<char>(in), {}) == "not a redo log");
+  }
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("Durable transactions grow the redo log under concurrent commits.") {
+  using T = transaction<int, 30, backend::durable>;
+  using Page = std::array<long long unsigned, 512>;
+  auto path = std::filesystem::temp_directory_path() / "stmxx_grow_test.log";
+  std::filesystem::remove(path);
+  constexpr int WRITERS = 4;
+  constexpr int COMMITS = 100;
+
+  // 4 KiB per record, well past the initial 1 MiB mapping.
+  REQUIRE(T::open_log(path));
+  {
+    std::vector<std::unique_ptr<transaction_t<Page, T>>> pages;
+    for (int i = 0; i < WRITERS; ++i) {
+      pages.push_back(std::make_unique<transaction_t<Page, T>>(Page{}));
+      REQUIRE(!pages.back()->persist(i));
+    }
+    std::vector<std::thread> threads;
+    for (int i = 0; i < WRITERS; ++i) {
+      threads.emplace_back([&, i] {
+        for (long long unsigned j = 1; j <= COMMITS; ++j) {
+          T::start([&] {
+            Page page;
+            page.fill(j);
+            *pages[i] = std::move(page);
+            return 0;
+          });
+        }
+      });
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+  }
+
+  using U = transaction<int, 31, backend::durable>;
+  REQUIRE(U::open_log(path));
+  for (int i = 0; i < WRITERS; ++i) {
+    transaction_t<Page, U> recovered = Page{};
+    REQUIRE(recovered.persist(i));
+    REQUIRE(std::ranges::all_of(**recovered, [](auto val) { return val == COMMITS; }));
+  }
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("Durable transactions drop a torn last record.") {
+  using T = transaction<int, 21, backend::durable>;
+  auto path = std::filesystem::temp_directory_path() / "stmxx_torn_test.log";
+  std::filesystem::remove(path);
+  constexpr long long unsigned marker = 0x5EEDC0FFEE15BAD5;
+
+  REQUIRE(T::open_log(path));
+  {
+    transaction_t<long long unsigned, T> tval = 0;
+    REQUIRE(!tval.persist(1));
+    for (auto val : {1ull, 2ull, marker}) {
+      T::start([&] {
+        tval = static_cast<long long unsigned>(val);
+        return 0;
+      });
+    }
+  }
+
+  // corrupt the value of the last record, as a crash in the middle of writing it would.
+  std::string bytes;
+  {
+    std::ifstream in(path, std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(in), {});
+  }
+  auto found = bytes.find(std::string_view(reinterpret_cast<const char *>(&marker), sizeof(marker)));
+  REQUIRE(found != std::string::npos);
+  {
+    std::fstream out(path, std::ios::binary | std::ios::in | std::ios::out);
+    out.seekp(found);
+    out.put(static_cast<char>(~bytes[found]));
+  }
+
+  using U = transaction<int, 22, backend::durable>;
+  REQUIRE(U::open_log(path));
+  transaction_t<long long unsigned, U> recovered = 0;
+  REQUIRE(recovered.persist(1));
+  REQUIRE(**recovered == 2);
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("Conflict profiler attributes aborts to tvals.") {
+  using T = transaction<int, 15>;
+  transaction_t<long long unsigned, T> tval = 0;
+  profiler::name(&tval, "counter");
+  profiler::reset();
+  profiler::enable();
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < THREADS; ++i) {
+    threads.emplace_back([&] {
+      T::start([&] {
+        auto val = *tval;
+        std::this_thread::sleep_for(1ms);
+        if (val) {
+          modify_tval(&tval, *val + 1);
+        }
+        return 0;
+      });
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  profiler::disable();
+  REQUIRE(**tval == THREADS);
+
+  auto spots = profiler::hotspots(1);
+  REQUIRE(spots.size() == 1);
+  REQUIRE(spots[0].tval == &tval);
+  REQUIRE(spots[0].name == "counter");
+  REQUIRE(spots[0].aborts > 0);
+
+  std::ostringstream trace;
+  profiler::export_chrome_trace(trace);
+  auto events = trace.str();
+  std::size_t commits = 0;
+  for (auto pos = events.find("\"commit\""); pos != std::string::npos;
+       pos = events.find("\"commit\"", pos + 1)) {
+    ++commits;
+  }
+  REQUIRE(commits == THREADS);
+
+  // an attempt aborted by an exception is not attributed to any tval.
+  profiler::reset();
+  profiler::enable();
+  REQUIRE_THROWS_AS(T::start([]() -> int { throw std::runtime_error("abort"); }),
+                    std::runtime_error);
+  profiler::disable();
+  std::ostringstream unattributed;
+  profiler::export_chrome_trace(unattributed);
+  REQUIRE(unattributed.str().find("\"abort\"") != std::string::npos);
+  REQUIRE(unattributed.str().find("\"args\"") == std::string::npos);
+  profiler::reset();
+}
+
+TEMPLATE_TEST_CASE("Deadline bounded transactions give up under contention.", "",
+                   (transaction<int, 16>), (transaction<int, 23, backend::norec>)) {
+  using T = TestType;
+  transaction_t<long long unsigned, T> tval = 0;
+
+  auto committed = T::start_for(100ms, [&] {
+    auto val = *tval;
+    if (val) {
+      modify_tval(&tval, *val + 1);
+    }
+    return 1;
+  });
+  REQUIRE(committed == 1);
+  REQUIRE(**tval == 1);
+
+  auto expired = T::start_until(std::chrono::steady_clock::now() - 1ms, [] { return 2; });
+  REQUIRE(!expired);
+
+  // a writer that commits continuously invalidates every slow attempt.
+  std::atomic<bool> stop = false;
+  std::thread writer([&] {
+    while (!stop) {
+      T::start([&] {
+        auto val = *tval;
+        if (val) {
+          modify_tval(&tval, *val + 1);
+        }
+        return 0;
+      });
+    }
+  });
+  auto timed_out = T::start_for(20ms, [&] {
+    auto val = *tval;
+    std::this_thread::sleep_for(5ms);
+    if (val) {
+      modify_tval(&tval, *val + 1);
+    }
+    return 3;
+  });
+  stop = true;
+  writer.join();
+  REQUIRE(!timed_out);
+}
+
+TEST_CASE("Read views inspect values in place.") {
+  using T = transaction<int, 17>;
+  transaction_t<std::vector<int>, T> tval = std::vector<int>(1000, 1);
+
+  auto sum = [](const std::vector<int> &vec) { return std::accumulate(vec.begin(), vec.end(), 0); };
+  REQUIRE(tval.read(sum) == 1000);
+  REQUIRE(T::start([&] { return tval.read(sum); }) == 1000);
+
+  // exceptions on a validated value are genuine and escape the transaction.
+  REQUIRE_THROWS_AS(T::start([&] {
+                      return tval.read([](const std::vector<int> &vec) { return vec.at(1000); });
+                    }),
+                    std::out_of_range);
+  REQUIRE(T::start([&] { return tval.read(sum); }) == 1000);
+}
+
+TEST_CASE("Read views discard torn values.") {
+  using T = transaction<int, 18>;
+  using Array = std::array<long long unsigned, 64>;
+  transaction_t<Array, T> tval = Array{};
+
+  std::atomic<bool> stop = false;
+  std::thread writer([&] {
+    for (long long unsigned i = 1; !stop; ++i) {
+      T::start([&] {
+        Array next;
+        next.fill(i);
+        tval = std::move(next);
+        return 0;
+      });
+    }
+  });
+  for (int i = 0; i < 1000; ++i) {
+    auto first = T::start([&] {
+      return tval.read([](const Array &arr) {
+        if (std::ranges::any_of(arr, [&](auto val) { return val != arr[0]; })) {
+          throw std::logic_error("torn read");
+        }
+        return arr[0];
+      });
+    });
+    REQUIRE(first);
+  }
+  stop = true;
+  writer.join();
+}
+
+TEST_CASE("Read views of heap owning values.") {
+  using T = transaction<int, 24>;
+  transaction_t<std::vector<long long unsigned>, T> tval =
+      std::vector<long long unsigned>(1, 1);
+
+  // every commit frees the buffer the previous value owned.
+  std::atomic<bool> stop = false;
+  std::thread writer([&] {
+    for (long long unsigned i = 1; !stop; ++i) {
+      T::start([&] {
+        auto size = i % 100 + 1;
+        tval = std::vector<long long unsigned>(size, size);
+        return 0;
+      });
+    }
+  });
+  for (int i = 0; i < 1000; ++i) {
+    auto consistent = T::start([&] {
+      return tval.read([](const std::vector<long long unsigned> &vec) {
+        return !vec.empty() && std::ranges::all_of(vec, [&](auto val) { return val == vec.size(); });
+      });
+    });
+    REQUIRE(consistent);
+    REQUIRE(*consistent);
+  }
+  stop = true;
+  writer.join();
+}
+
+TEST_CASE("Read views do not conflict with other readers.") {
+  using T = transaction<int, 26>;
+  using Vector = std::vector<long long unsigned>;
+  transaction_t<Vector, T> tval = Vector(10000, 1);
+
+  // read only transactions on the same value never abort each other.
+  std::atomic<int> attempts = 0;
+  std::atomic<bool> FAILED = false;
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&] {
+      for (int j = 0; j < 100; ++j) {
+        auto sum = T::start([&] {
+          ++attempts;
+          // reading the same value again inside fn's transaction is fine as well.
+          auto first = tval.read([](const Vector &vec) { return vec.front(); });
+          return tval.read([](const Vector &vec) { return std::reduce(vec.begin(), vec.end()); })
+              .value_or(0) * first.value_or(0);
+        });
+        if (sum != 10000) {
+          FAILED = true;
+        }
+      }
+    });
+  }
+  for (auto &reader : readers) {
+    reader.join();
+  }
+  REQUIRE(!FAILED);
+  REQUIRE(attempts == 400);
+
+  // workers reading the same value don't fail their parent either.
+  attempts = 0;
+  T::start([&] {
+    ++attempts;
+    T::parallel_for(0, 8, [&](std::size_t) { tval.read([](const Vector &vec) { return vec[0]; }); },
+                    4);
+    return 0;
+  });
+  REQUIRE(attempts == 1);
+
+  // slow readers neither block nor abort a blind writer.
+  std::atomic<bool> stop = false;
+  attempts = 0;
+  readers.clear();
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&] {
+      while (!stop) {
+        T::start([&] {
+          return tval.read([](const Vector &vec) { return std::reduce(vec.begin(), vec.end()); });
+        });
+      }
+    });
+  }
+  for (long long unsigned i = 2; i < 102; ++i) {
+    T::start([&] {
+      ++attempts;
+      tval = Vector(10000, i);
+      return 0;
+    });
+  }
+  stop = true;
+  for (auto &reader : readers) {
+    reader.join();
+  }
+  REQUIRE(attempts == 100);
+  REQUIRE((**tval)[0] == 101);
+}
+
+TEMPLATE_TEST_CASE("Parallel for inside a single transaction.", "", (transaction<int, 19>),
+                   (transaction<int, 25, backend::norec>)) {
+  using T = TestType;
+  constexpr int CELLS = 64;
+  std::vector<std::unique_ptr<transaction_t<long long unsigned, T>>> cells;
+  for (int i = 0; i < CELLS; ++i) {
+    cells.push_back(std::make_unique<transaction_t<long long unsigned, T>>(0LLU));
+  }
+  transaction_t<long long unsigned, T> rounds = 0;
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < 10; ++j) {
+        T::start([&] {
+          auto val = *rounds;
+          if (val) {
+            modify_tval(&rounds, *val + 1);
+          }
+          // workers are served from the read log of their parent.
+          for (auto &cell : cells) {
+            [[maybe_unused]] auto cell_val = **cell;
+          }
+          T::parallel_for(0, CELLS, [&](std::size_t cell) {
+            // workers see the uncommitted write of their parent.
+            auto round = *rounds;
+            auto cell_val = **cells[cell];
+            if (round && cell_val) {
+              modify_tval(cells[cell].get(), *cell_val + 1);
+            }
+          }, 4);
+          return 0;
+        });
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  REQUIRE(**rounds == 40);
+  REQUIRE(std::ranges::all_of(cells, [](auto &cell) { return **cell == 40; }));
+
+  REQUIRE_THROWS_AS(T::parallel_for(0, 8,
+                                    [](std::size_t i) {
+                                      if (i == 5) {
+                                        throw std::runtime_error("worker failed");
+                                      }
+                                    }),
+                    std::runtime_error);
+
+  // workers do not see each other's writes, updating one tval from several of them is rejected.
+  transaction_t<long long unsigned, T> counter = 0;
+  REQUIRE_THROWS_AS(T::parallel_for(0, 8,
+                                    [&](std::size_t) {
+                                      auto val = *counter;
+                                      if (val) {
+                                        modify_tval(&counter, *val + 1);
+                                      }
+                                    },
+                                    2),
+                    parallel_conflict);
+  REQUIRE(**counter == 0);
+
+  // write skew: each worker writes what the other one read, also when the parent read both first.
+  transaction_t<long long unsigned, T> x = 0;
+  transaction_t<long long unsigned, T> y = 0;
+  REQUIRE_THROWS_AS(T::start([&] {
+                      [[maybe_unused]] auto x_val = *x;
+                      [[maybe_unused]] auto y_val = *y;
+                      T::parallel_for(0, 2,
+                                      [&](std::size_t i) {
+                                        auto &from = i ? y : x;
+                                        auto &to = i ? x : y;
+                                        auto val = *from;
+                                        if (val) {
+                                          modify_tval(&to, *val + 1);
+                                        }
+                                      },
+                                      2);
+                      return 0;
+                    }),
+                    parallel_conflict);
+  REQUIRE(**x == 0);
+  REQUIRE(**y == 0);
+}